@@ -33,6 +33,22 @@
 #define _FC8_MAX_MATCHES (128L*1024)
 #define _FC8_LONGEST_LITERAL_RUN 64
 
+/* Number of matching low-order bytes in a nonzero XOR of two 64-bit words */
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  #define _FC8_MATCHING_BYTES(x) ((uint32_t)__builtin_ctzll(x) >> 3)
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  #define _FC8_MATCHING_BYTES(x) ((uint32_t)__builtin_clzll(x) >> 3)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+  #include <intrin.h>
+  static uint32_t _FC8_MatchingBytes(uint64_t x)
+  {
+      unsigned long index;
+      _BitScanForward64(&index, x);
+      return (uint32_t)index >> 3;
+  }
+  #define _FC8_MATCHING_BYTES(x) _FC8_MatchingBytes(x)
+#endif
+
 /* LUT for encoding the copy length parameter */
 const uint8_t _FC8_LENGTH_ENCODE_LUT[257] = {
     255,255,255,0,1,2,3,4,5,6,7,8,9,10,11,12,         /* 0 - 15 */
@@ -80,6 +96,17 @@ const uint16_t _FC8_LENGTH_QUANT_LUT[257] = {
     256                                                              /* 256 */
 };
 
+/* The set of BR2 lengths in use, either the default LUTs above or a table chosen for one file */
+typedef struct {
+    const uint16_t *decode;
+    const uint16_t *quant;
+    const uint8_t *encode;
+} length_lut_t;
+
+static const length_lut_t _FC8_DEFAULT_LENGTH_LUT = {
+    _FC8_LENGTH_DECODE_LUT, _FC8_LENGTH_QUANT_LUT, _FC8_LENGTH_ENCODE_LUT
+};
+
 uint32_t GetUInt32(const uint8_t *in)
 {
     return ((uint32_t)in[0]) << 24 |
@@ -180,12 +207,51 @@ uint32_t GetCompressedSizeForMatch(uint32_t dist, uint32_t length)
     return 0xFFFFFFFF;
 }
 
-static uint32_t FindMatch(search_accel_t *sa, const uint8_t *inputStart, const uint8_t *inputEnd, const uint8_t *curPos, uint8_t symbolCost, uint32_t *matchOffset)
+static uint64_t GetUInt64Native(const uint8_t *in)
+{
+    uint64_t val;
+    memcpy(&val, in, sizeof(val));
+    return val;
+}
+
+static uint32_t GetUInt32Native(const uint8_t *in)
+{
+    uint32_t val;
+    memcpy(&val, in, sizeof(val));
+    return val;
+}
+
+/* Advance curPtr and prevPtr while they point to matching bytes, stopping at endStr.
+   Returns the new curPtr. Compares 8 bytes at a time where the byte order is known. */
+static const uint8_t* ExtendMatch(const uint8_t *curPtr, const uint8_t *prevPtr, const uint8_t *endStr)
+{
+#ifdef _FC8_MATCHING_BYTES
+    while (curPtr + sizeof(uint64_t) <= endStr)
+    {
+        uint64_t diff = GetUInt64Native(curPtr) ^ GetUInt64Native(prevPtr);
+        if (diff)
+            return curPtr + _FC8_MATCHING_BYTES(diff);
+        curPtr += sizeof(uint64_t);
+        prevPtr += sizeof(uint64_t);
+    }
+#endif
+
+    while (curPtr < endStr && *curPtr == *prevPtr)
+    {
+        ++curPtr;
+        ++prevPtr;
+    }
+    return curPtr;
+}
+
+static uint32_t FindMatch(search_accel_t *sa, const uint8_t *inputStart, const uint8_t *inputEnd, const uint8_t *curPos, uint8_t symbolCost,
+    const length_lut_t *lut, uint32_t *matchOffset, uint32_t *fullLength)
 {
     uint32_t matchLength, bestLength = 2, dist, preMatch, maxMatches, win, bestWin = 0;
-    uint8_t *prevPos, *curPtr, *prevPtr, *minPos, *endStr;
+    uint8_t *prevPos, *curPtr, *minPos, *endStr;
 
     *matchOffset = 0;
+    *fullLength = 0;
 
     /* Minimum search position */
     if ((uint32_t)(curPos - inputStart) >= _FC8_WINDOW_SIZE)
@@ -208,24 +274,22 @@ static uint32_t FindMatch(search_accel_t *sa, const uint8_t *inputStart, const u
     maxMatches = _FC8_MAX_MATCHES;
     while (prevPos && (prevPos > minPos) && (maxMatches--))
     {
-        /* If we don't have a match at bestLength, don't even bother... */
-        if (curPos[bestLength] == prevPos[bestLength])
+        /* If we don't have a match for the 4 bytes ending at bestLength, don't even bother.
+           The first 3 bytes are always pre-matched, so there's nothing to check until a
+           match longer than that has been found. */
+        if (bestLength <= preMatch - 1 ||
+            GetUInt32Native(curPos + bestLength - 3) == GetUInt32Native(prevPos + bestLength - 3))
         {
             /* Calculate maximum match length for this offset */
-            curPtr = (uint8_t*)curPos + preMatch;
-            prevPtr = prevPos + preMatch;
-            while (curPtr < endStr && *curPtr == *prevPtr)
-            {
-                ++curPtr;
-                ++prevPtr;
-            }
+            curPtr = (uint8_t*)ExtendMatch(curPos + preMatch, prevPos + preMatch, endStr);
             matchLength = curPtr - curPos;
 
-            /* Quantize length */
-            matchLength = _FC8_LENGTH_QUANT_LUT[matchLength];
-
             dist = (uint32_t)(curPos - prevPos);
 
+            /* Quantize length, if it needs a BR2 */
+            if (GetCompressedSizeForMatch(dist, matchLength) == 3)
+                matchLength = lut->quant[matchLength];
+
             /* Get actual compression win for this match */
             win = matchLength + symbolCost - 1 - GetCompressedSizeForMatch(dist, matchLength);
 
@@ -235,10 +299,11 @@ static uint32_t FindMatch(search_accel_t *sa, const uint8_t *inputStart, const u
                 bestWin = win;
                 *matchOffset = dist;
                 bestLength = matchLength;
+                *fullLength = curPtr - curPos;
 
                 /* Did we find a match that was good enough, or did we reach
                     the end of the buffer (no longer match is possible)? */
-                if ((matchLength >= _FC8_MAX_MATCH_LENGTH) || (curPtr >= endStr))
+                if ((matchLength >= lut->decode[31]) || (curPtr >= endStr))
                     break;
             }
         }
@@ -254,17 +319,77 @@ static uint32_t FindMatch(search_accel_t *sa, const uint8_t *inputStart, const u
         return 0;
 }
 
-uint32_t Encode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+static uint8_t* WriteBackref(uint8_t *dst, uint32_t offset, uint32_t length, uint32_t backrefSize, const length_lut_t *lut)
+{
+    // LIT = 00aaaaaa  next aaaaaa+1 bytes are literals
+    // BR0 = 01baaaaa  offset aaaaa, length b+3
+    // BR1 = 10bbbaaa'aaaaaaaa   offset aaa'aaaaaaaa, length bbb+3
+    // BR2 = 11bbbbba'aaaaaaaa'aaaaaaaa   offset a'aaaaaaaa'aaaaaaaa, length lookup_table[bbbbb]
+    // EOF = 01x00000   end of file
+    if (backrefSize == 1)
+    {
+        *dst++ = (uint8_t)(0x40 | offset | ((length-3)<<5));
+    }
+    else if (backrefSize == 2)
+    {
+        *dst++ = (uint8_t)(0x80 | ((length-3)<<3) | (offset >> 8));
+        *dst++ = (uint8_t)(offset);
+    }
+    else if (backrefSize == 3)
+    {
+        *dst++ = (uint8_t)(0xC0 | (lut->encode[length]<<1) | (offset >> 16));
+        *dst++ = (uint8_t)(offset >> 8);
+        *dst++ = (uint8_t)(offset);
+    }
+
+    return dst;
+}
+
+/* Write a backref of any length as one or more tokens. Lengths that can't be encoded
+   directly are split, taking care that no piece is shorter than the minimum length of 3.
+   Returns the new output position, or NULL if the output buffer is full. */
+static uint8_t* WriteLongBackref(uint8_t *dst, uint8_t *outEnd, uint32_t offset, uint32_t length)
+{
+    uint32_t piece, backrefSize;
+
+    while (length)
+    {
+        piece = length < _FC8_MAX_MATCH_LENGTH ? length : _FC8_MAX_MATCH_LENGTH;
+        piece = _FC8_LENGTH_QUANT_LUT[piece];
+        while (length - piece == 1 || length - piece == 2)
+            piece = _FC8_LENGTH_QUANT_LUT[piece - 1];
+
+        // BR0 and BR1 can encode short lengths exactly
+        backrefSize = GetCompressedSizeForMatch(offset, length);
+        if (backrefSize < 3)
+            piece = length;
+        else
+            backrefSize = GetCompressedSizeForMatch(offset, piece);
+
+        if (outEnd - dst < (int32_t)backrefSize)
+            return (uint8_t*) 0;
+
+        dst = WriteBackref(dst, offset, piece, backrefSize, &_FC8_DEFAULT_LENGTH_LUT);
+        length -= piece;
+    }
+
+    return dst;
+}
+
+/* Compress with the given BR2 lengths. If histogram isn't NULL, it counts the full
+   (unquantized) lengths of the matches that were encoded as BR2. */
+static uint32_t EncodeTokensLUT(const uint8_t *in, uint32_t histsize, uint32_t insize, uint8_t *out, uint32_t outsize,
+    const length_lut_t *lut, uint32_t *histogram)
 {
     uint8_t *src, *inEnd, *dst, *outEnd, symbol;
     uint32_t compressedSize, backrefSize;
-    uint32_t length, offset = 0, symbolCost, i;
+    uint32_t length, fullLength, offset = 0, symbolCost, i;
     uint8_t* pRunLengthByte = NULL;
     uint32_t literalRunLength = 0;
     search_accel_t *sa = (search_accel_t*) 0;
 
     /* Check arguments */
-    if ((!in) || (!out) || (outsize < (FC8_HEADER_SIZE + insize)))
+    if ((!in) || (!out) || (outsize < insize))
         goto fail;
 
     /* Initialize search accelerator */
@@ -273,11 +398,17 @@ uint32_t Encode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsi
         goto fail;
 
     /* Initialize the byte streams */
-    src = (uint8_t *)in;
-    inEnd = ((uint8_t *)in) + insize;
-    dst = out + FC8_HEADER_SIZE;
+    src = (uint8_t *)in + histsize;
+    inEnd = src + insize;
+    dst = out;
     outEnd = out + outsize;
 
+    /* Preload the search accelerator with the history, if any */
+    if (histsize > _FC8_WINDOW_SIZE)
+        goto fail;
+    for (i = 0; i < histsize && i + 3 <= histsize + insize; ++i)
+        UpdateLastPos(sa, in, (uint8_t *)in + i);
+
     /* Main compression loop */
     while (src < inEnd)
     {
@@ -299,7 +430,7 @@ uint32_t Encode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsi
         }    
 
         /* Find best history match for this position in the input buffer */
-        length = FindMatch(sa, in, inEnd, src, symbolCost, &offset);
+        length = FindMatch(sa, in, inEnd, src, symbolCost, lut, &offset, &fullLength);
 
         if (length > 0)
         {
@@ -314,30 +445,15 @@ uint32_t Encode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsi
             backrefSize = GetCompressedSizeForMatch(offset, length);
             if (backrefSize > 3)
                 goto fail;
+
+            if (histogram && backrefSize == 3)
+                histogram[fullLength]++;
             
-            // LIT = 00aaaaaa  next aaaaaa+1 bytes are literals
-            // BR0 = 01baaaaa  offset aaaaa, length b+3
-            // BR1 = 10bbbaaa'aaaaaaaa   offset aaa'aaaaaaaa, length bbb+3
-            // BR2 = 11bbbbba'aaaaaaaa'aaaaaaaa   offset a'aaaaaaaa'aaaaaaaa, length lookup_table[bbbbb]
-            // EOF = 01x00000   end of file
-            if (backrefSize == 1)
-            {
-                *dst++ = (uint8_t)(0x40 | offset | ((length-3)<<5));
-            }
-            else if (backrefSize == 2)
-            {
-                *dst++ = (uint8_t)(0x80 | ((length-3)<<3) | (offset >> 8));
-                *dst++ = (uint8_t)(offset);
-            }
-            else if (backrefSize == 3)
-            {
-                *dst++ = (uint8_t)(0xC0 | (_FC8_LENGTH_ENCODE_LUT[length]<<1) | (offset >> 16));
-                *dst++ = (uint8_t)(offset >> 8);
-                *dst++ = (uint8_t)(offset);
-            }
+            if ((uint32_t)(outEnd - dst) < backrefSize) goto overflow;
+            dst = WriteBackref(dst, offset, length, backrefSize, lut);
 
             /* Skip ahead (and update search accelerator)... */
-            for (i = 1; i < length; ++i)
+            for (i = 1; i < length && src + i + 3 <= inEnd; ++i)
                 UpdateLastPos(sa, in, src + i);
             src += length;
         }
@@ -346,6 +462,7 @@ uint32_t Encode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsi
             // literal
             if (literalRunLength == 0)
             {
+                if (dst >= outEnd) goto overflow;
                 pRunLengthByte = dst;
                 *dst++; // skip a byte for the run length
             }
@@ -372,6 +489,7 @@ uint32_t Encode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsi
     }
 
     // insert EOF
+    if (dst >= outEnd) goto overflow;
     *dst++ = 0x40;
 
     /* Free resources */
@@ -379,14 +497,6 @@ uint32_t Encode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsi
 
     compressedSize = dst - out;
 
-    /* Set header data */
-    out[0] = 'F';
-    out[1] = 'C';
-    out[2] = '8';
-    out[3] = '_';
-
-    SetUInt32(out + FC8_DECODED_SIZE_OFFSET, insize);
-
     /* Return size of compressed buffer */
     return compressedSize;
 
@@ -407,29 +517,408 @@ fail:
 }
 
 
-uint32_t Decode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+uint32_t EncodeTokens(const uint8_t *in, uint32_t histsize, uint32_t insize, uint8_t *out, uint32_t outsize)
 {
-    uint8_t *src, *dst, symbol, symbolType;
-    uint32_t  i, length, offset;
+    return EncodeTokensLUT(in, histsize, insize, out, outsize, &_FC8_DEFAULT_LENGTH_LUT, NULL);
+}
+
+
+/* Fill in the quantize and encode LUTs for a table of 32 increasing BR2 lengths, starting at 3 */
+static void BuildLengthLUT(const uint16_t *decode, uint16_t *quant, uint8_t *encode)
+{
+    uint32_t length, index = 0;
+
+    for (length = 0; length <= _FC8_MAX_MATCH_LENGTH; length++)
+    {
+        while (index < 31 && decode[index+1] <= length)
+            index++;
+
+        quant[length] = length < 3 ? 0 : decode[index];
+        encode[length] = length < 3 ? 255 : (uint8_t)index;
+    }
+}
+
+/* Choose the 32 BR2 lengths that lose the fewest matched bytes to quantization, given a
+   histogram of full match lengths. Each table length covers the match lengths from itself up
+   to the next table length, and a match of length L quantized to Q loses L-Q bytes that
+   must be encoded again. The first length is always 3, and the rest are found by dynamic
+   programming over where each length's range ends. */
+static void ChooseLengthTable(const uint32_t *histogram, uint16_t *decode)
+{
+    #define _FC8_NUM_LENGTHS (_FC8_MAX_MATCH_LENGTH + 2)
+    double count[_FC8_NUM_LENGTHS], sum[_FC8_NUM_LENGTHS];
+    double cost[32][_FC8_NUM_LENGTHS];
+    uint16_t start[32][_FC8_NUM_LENGTHS];
+    double c;
+    uint32_t k, i, j, end;
+
+    /* Prefix sums, so the loss for table length a covering [a,b) is
+       (sum[b]-sum[a]) - a*(count[b]-count[a]) */
+    count[3] = sum[3] = 0;
+    for (i = 3; i <= _FC8_MAX_MATCH_LENGTH; i++)
+    {
+        count[i+1] = count[i] + histogram[i];
+        sum[i+1] = sum[i] + (double)histogram[i] * i;
+    }
+
+    /* cost[k][j] = least loss covering [3,j) with k+1 table lengths, the last of which ends at j */
+    for (j = 4; j < _FC8_NUM_LENGTHS; j++)
+    {
+        cost[0][j] = (sum[j] - sum[3]) - 3.0 * (count[j] - count[3]);
+        start[0][j] = 3;
+    }
+    for (k = 1; k < 32; k++)
+    {
+        for (j = 4 + k; j < _FC8_NUM_LENGTHS; j++)
+        {
+            cost[k][j] = -1;
+            for (i = 3 + k; i < j; i++)
+            {
+                c = cost[k-1][i] + (sum[j] - sum[i]) - (double)i * (count[j] - count[i]);
+                if (cost[k][j] < 0 || c < cost[k][j])
+                {
+                    cost[k][j] = c;
+                    start[k][j] = (uint16_t)i;
+                }
+            }
+        }
+    }
+
+    /* Walk back from the last range, which ends after the longest match */
+    end = _FC8_NUM_LENGTHS - 1;
+    for (k = 32; k > 0; k--)
+    {
+        decode[k-1] = start[k-1][end];
+        end = decode[k-1];
+    }
+    #undef _FC8_NUM_LENGTHS
+}
+
+uint32_t EncodeAdaptive(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    uint32_t histogram[_FC8_MAX_MATCH_LENGTH + 1];
+    uint16_t decode[32], quant[_FC8_MAX_MATCH_LENGTH + 1];
+    uint8_t encode[_FC8_MAX_MATCH_LENGTH + 1];
+    length_lut_t lut;
+    uint32_t defaultSize, tableSize, i;
+    uint8_t *tableBuf;
+
+    /* Check arguments */
+    if ((!out) || (outsize < FC8_HEADER_SIZE))
+        return 0;
+
+    /* First pass with the default lengths, to find the match length histogram */
+    memset(histogram, 0, sizeof(histogram));
+    defaultSize = EncodeTokensLUT(in, 0, insize, out + FC8_HEADER_SIZE, outsize - FC8_HEADER_SIZE, &_FC8_DEFAULT_LENGTH_LUT, histogram);
+    if (!defaultSize)
+        return 0;
+    defaultSize += FC8_HEADER_SIZE;
+
+    /* No room for the table header, so keep the default lengths */
+    if (outsize <= FC8_TABLE_HEADER_SIZE)
+        goto useDefault;
+
+    /* Second pass with lengths chosen for this data */
+    ChooseLengthTable(histogram, decode);
+    BuildLengthLUT(decode, quant, encode);
+    lut.decode = decode;
+    lut.quant = quant;
+    lut.encode = encode;
+
+    tableBuf = (uint8_t*)malloc(outsize - FC8_TABLE_HEADER_SIZE);
+    if (!tableBuf)
+        return 0;
+    tableSize = EncodeTokensLUT(in, 0, insize, tableBuf, outsize - FC8_TABLE_HEADER_SIZE, &lut, NULL);
+
+    /* Keep whichever is smaller, including the 32 byte table */
+    if (tableSize && FC8_TABLE_HEADER_SIZE + tableSize < defaultSize)
+    {
+        memcpy(out + FC8_TABLE_HEADER_SIZE, tableBuf, tableSize);
+        free(tableBuf);
+
+        /* Set header data */
+        out[0] = 'F';
+        out[1] = 'C';
+        out[2] = '8';
+        out[3] = 't';
+
+        SetUInt32(out + FC8_DECODED_SIZE_OFFSET, insize);
+
+        /* Table is stored as length-1, like the 68K decoder's LUT */
+        for (i = 0; i < 32; i++)
+            out[FC8_LENGTH_TABLE_OFFSET + i] = (uint8_t)(decode[i] - 1);
+
+        return FC8_TABLE_HEADER_SIZE + tableSize;
+    }
+
+    free(tableBuf);
+
+useDefault:
+    /* Set header data */
+    out[0] = 'F';
+    out[1] = 'C';
+    out[2] = '8';
+    out[3] = '_';
+
+    SetUInt32(out + FC8_DECODED_SIZE_OFFSET, insize);
+
+    return defaultSize;
+}
+
+
+uint32_t Encode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    uint32_t compressedSize;
+
+    /* Check arguments */
+    if ((!out) || (outsize < FC8_HEADER_SIZE))
+        return 0;
+
+    compressedSize = EncodeTokens(in, 0, insize, out + FC8_HEADER_SIZE, outsize - FC8_HEADER_SIZE);
+    if (!compressedSize)
+        return 0;
+
+    /* Set header data */
+    out[0] = 'F';
+    out[1] = 'C';
+    out[2] = '8';
+    out[3] = '_';
+
+    SetUInt32(out + FC8_DECODED_SIZE_OFFSET, insize);
+
+    /* Return size of compressed buffer */
+    return FC8_HEADER_SIZE + compressedSize;
+}
+
+
+/* Find the smallest number of bytes by which the output buffer must be larger than the decoded
+   size, so that the compressed data can be placed at the end of the output buffer and decoded
+   in place. Before each token is read, everything written so far must lie in front of it. The
+   distance from the start of the buffer to the start of the compressed data is
+   decodedSize + margin - insize, so for every token boundary:
+   written <= decodedSize + margin - insize + read
+   Returns 0xFFFFFFFF if the token stream is invalid. */
+static uint32_t GetTokenMargin(const uint8_t *in, uint32_t headerSize, uint32_t insize, uint32_t decodedSize, const uint16_t *lengthLUT)
+{
+    uint32_t read = headerSize, written = 0, length;
+    int64_t maxAhead = -(int64_t)headerSize, margin;
+    uint8_t symbol;
+
+    while (read < insize)
+    {
+        symbol = in[read];
+
+        switch (symbol >> 6)
+        {
+        case 0:
+            // LIT = 00aaaaaa  next aaaaaa+1 bytes are literals
+            length = symbol + 1;
+            read += 1 + length;
+            break;
+
+        case 1:
+            // BR0 = 01baaaaa  backref offset aaaaa, length b+3
+            if ((symbol & 0x1F) == 0)
+            {
+                // EOF, which is the last byte read
+                margin = maxAhead + insize - decodedSize;
+                if (written != decodedSize)
+                    return 0xFFFFFFFF;
+                return margin > 0 ? (uint32_t)margin : 0;
+            }
+            length = 3 + ((symbol >> 5) & 0x01);
+            read += 1;
+            break;
+
+        case 2:
+            // BR1 = 10bbbaaa'aaaaaaaa   backref offset aaa'aaaaaaaa, length bbb+3
+            length = 3 + ((symbol >> 3) & 0x07);
+            read += 2;
+            break;
+
+        default:
+            // BR2 = 11bbbbba'aaaaaaaa'aaaaaaaa   backref offset a'aaaaaaaa'aaaaaaaa, length lookup_table[bbbbb]
+            length = lengthLUT[(symbol >> 1) & 0x1f];
+            read += 3;
+            break;
+        }
+
+        written += length;
+        if ((int64_t)written - read > maxAhead)
+            maxAhead = (int64_t)written - read;
+    }
+
+    /* No EOF */
+    return 0xFFFFFFFF;
+}
+
+/* Load the BR2 length table from an FC8t header */
+static void GetLengthTable(const uint8_t *in, uint16_t *lengthLUT)
+{
+    uint32_t i;
+
+    for (i = 0; i < 32; i++)
+        lengthLUT[i] = (uint16_t)in[FC8_LENGTH_TABLE_OFFSET + i] + 1;
+}
+
+uint32_t GetInPlaceMargin(const uint8_t *in, uint32_t insize)
+{
+    uint16_t lengthLUT[32];
 
     /* Does the input buffer at least contain the header? */
-    if (insize < FC8_HEADER_SIZE)
+    if (insize < FC8_HEADER_SIZE || (in[0] != 'F') || (in[1] != 'C') || (in[2] != '8'))
+        return 0xFFFFFFFF;
+
+    if (in[3] == 'i' && insize >= FC8_INPLACE_HEADER_SIZE)
+        return GetUInt32(&in[FC8_MARGIN_OFFSET]);
+    else if (in[3] == '_')
+        return GetTokenMargin(in, FC8_HEADER_SIZE, insize, GetUInt32(&in[FC8_DECODED_SIZE_OFFSET]), _FC8_LENGTH_DECODE_LUT);
+    else if (in[3] == 't' && insize >= FC8_TABLE_HEADER_SIZE)
+    {
+        GetLengthTable(in, lengthLUT);
+        return GetTokenMargin(in, FC8_TABLE_HEADER_SIZE, insize, GetUInt32(&in[FC8_DECODED_SIZE_OFFSET]), lengthLUT);
+    }
+
+    return 0xFFFFFFFF;
+}
+
+uint32_t EncodeInPlace(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    uint32_t compressedSize;
+
+    /* Check arguments */
+    if ((!out) || (outsize < FC8_INPLACE_HEADER_SIZE))
         return 0;
 
-    /* Check magic number */
-    if ((in[0] != 'F') || (in[1] != 'C') || (in[2] != '8') || (in[3] != '_'))
+    compressedSize = EncodeTokens(in, 0, insize, out + FC8_INPLACE_HEADER_SIZE, outsize - FC8_INPLACE_HEADER_SIZE);
+    if (!compressedSize)
         return 0;
+    compressedSize += FC8_INPLACE_HEADER_SIZE;
 
-    /* Get & check output buffer size */
-    if (outsize < GetUInt32(&in[FC8_DECODED_SIZE_OFFSET]))
+    /* Set header data */
+    out[0] = 'F';
+    out[1] = 'C';
+    out[2] = '8';
+    out[3] = 'i';
+
+    SetUInt32(out + FC8_DECODED_SIZE_OFFSET, insize);
+    SetUInt32(out + FC8_MARGIN_OFFSET, GetTokenMargin(out, FC8_INPLACE_HEADER_SIZE, compressedSize, insize, _FC8_LENGTH_DECODE_LUT));
+
+    /* Return size of compressed buffer */
+    return compressedSize;
+}
+
+
+uint32_t TranscodeLZ4(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    const uint8_t *src, *inEnd;
+    uint8_t *dst, *outEnd, token, extra;
+    uint32_t length, run, offset, decodedSize = 0;
+
+    /* Check arguments */
+    if ((!in) || (!out) || (outsize < FC8_HEADER_SIZE + 1))
         return 0;
 
+    /* Initialize the byte streams */
+    src = in;
+    inEnd = in + insize;
+    dst = out + FC8_HEADER_SIZE;
+    outEnd = out + outsize;
+
+    /* Each LZ4 sequence is a token, literals, and a backref, except the last which has only literals.
+       Token = llllmmmm, literal length llll and match length mmmm+4, with 15 meaning more length
+       bytes follow. LZ4 offsets are at most 65535, so every backref fits in the FC8 window. */
+    while (src < inEnd)
+    {
+        token = *src++;
+
+        length = token >> 4;
+        if (length == 15)
+        {
+            do
+            {
+                if (src >= inEnd)
+                    return 0;
+                extra = *src++;
+                length += extra;
+            } while (extra == 255);
+        }
+
+        if (length > (uint32_t)(inEnd - src))
+            return 0;
+
+        // LIT = 00aaaaaa  next aaaaaa+1 bytes are literals
+        decodedSize += length;
+        while (length)
+        {
+            run = length < _FC8_LONGEST_LITERAL_RUN ? length : _FC8_LONGEST_LITERAL_RUN;
+            if ((uint32_t)(outEnd - dst) < run + 1)
+                return 0;
+
+            *dst++ = (uint8_t)(run - 1);
+            memcpy(dst, src, run);
+            dst += run;
+            src += run;
+            length -= run;
+        }
+
+        // end of the last sequence?
+        if (src == inEnd)
+            break;
+
+        if (inEnd - src < 2)
+            return 0;
+        offset = ((uint32_t)src[1] << 8) | src[0];
+        src += 2;
+
+        length = (token & 0x0F) + 4;
+        if ((token & 0x0F) == 15)
+        {
+            do
+            {
+                if (src >= inEnd)
+                    return 0;
+                extra = *src++;
+                length += extra;
+            } while (extra == 255);
+        }
+
+        // backref before the start of the data, or a decoded size that can't be stored?
+        if (offset == 0 || offset > decodedSize || length > 0xFFFFFFFF - decodedSize)
+            return 0;
+
+        dst = WriteLongBackref(dst, outEnd, offset, length);
+        if (!dst)
+            return 0;
+        decodedSize += length;
+    }
+
+    // insert EOF
+    if (dst >= outEnd)
+        return 0;
+    *dst++ = 0x40;
+
+    /* Set header data */
+    out[0] = 'F';
+    out[1] = 'C';
+    out[2] = '8';
+    out[3] = '_';
+
+    SetUInt32(out + FC8_DECODED_SIZE_OFFSET, decodedSize);
+
+    /* Return size of compressed buffer */
+    return dst - out;
+}
+
+
+static uint32_t DecodeTokensLUT(const uint8_t *in, uint8_t *out, const uint16_t *lengthLUT)
+{
+    uint8_t *src, *dst, symbol, symbolType;
+    uint32_t  i, length, offset;
+
     /* Initialize the byte streams */
     src = (unsigned char *)in;
     dst = out;
-    
-    /* Skip header information */
-    src += FC8_HEADER_SIZE;
 	
     /* Main decompression loop */
     while (1)
@@ -469,7 +958,7 @@ uint32_t Decode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsi
 
         case 3:
             // BR2 = 11bbbbba'aaaaaaaa'aaaaaaaa   backref offset a'aaaaaaaa'aaaaaaaa, length lookup_table[bbbbb]
-            length = _FC8_LENGTH_DECODE_LUT[(symbol >> 1) & 0x1f];
+            length = lengthLUT[(symbol >> 1) & 0x1f];
             offset = (((uint32_t)(symbol & 0x01)) << 16) | (((uint32_t)src[0]) << 8) | src[1];
             src += 2;
             for (i=0; i<length; i++)
@@ -480,4 +969,66 @@ uint32_t Decode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsi
 
 eof:
     return dst - out;
+}
+
+
+uint32_t DecodeTokens(const uint8_t *in, uint8_t *out)
+{
+    return DecodeTokensLUT(in, out, _FC8_LENGTH_DECODE_LUT);
+}
+
+
+uint32_t Decode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    uint16_t lengthLUT[32];
+
+    /* Does the input buffer at least contain the header? */
+    if (insize < FC8_HEADER_SIZE)
+        return 0;
+
+    /* Check magic number */
+    if ((in[0] != 'F') || (in[1] != 'C') || (in[2] != '8') || (in[3] != '_' && in[3] != 'i' && in[3] != 't'))
+        return 0;
+
+    /* Get & check output buffer size */
+    if (outsize < GetUInt32(&in[FC8_DECODED_SIZE_OFFSET]))
+        return 0;
+
+    /* Skip header information */
+    if (in[3] == 'i')
+    {
+        if (insize < FC8_INPLACE_HEADER_SIZE)
+            return 0;
+        return DecodeTokens(in + FC8_INPLACE_HEADER_SIZE, out);
+    }
+    else if (in[3] == 't')
+    {
+        if (insize < FC8_TABLE_HEADER_SIZE)
+            return 0;
+        GetLengthTable(in, lengthLUT);
+        return DecodeTokensLUT(in + FC8_TABLE_HEADER_SIZE, out, lengthLUT);
+    }
+    return DecodeTokens(in + FC8_HEADER_SIZE, out);
+}
+
+
+uint32_t DecodeInPlace(uint8_t *buf, uint32_t bufsize, uint32_t insize)
+{
+    uint8_t *in;
+    uint32_t decodedSize, margin;
+
+    /* The compressed data is at the end of the buffer */
+    if (insize > bufsize)
+        return 0;
+    in = buf + bufsize - insize;
+
+    /* Check that the data can't be overwritten before it's read */
+    margin = GetInPlaceMargin(in, insize);
+    if (margin == 0xFFFFFFFF)
+        return 0;
+    decodedSize = GetUInt32(&in[FC8_DECODED_SIZE_OFFSET]);
+    if (bufsize < decodedSize || bufsize - decodedSize < margin)
+        return 0;
+
+    return Decode(in, insize, buf, bufsize);
 }
\ No newline at end of file
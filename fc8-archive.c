@@ -0,0 +1,322 @@
+/*
+* FC8 compression by Steve Chamberlin, 2016
+* Some concepts and code derived from liblzg by Marcus Geelnard, 2010
+*
+* This software is provided 'as-is', without any express or implied
+* warranty. In no event will the authors be held liable for any damages
+* arising from the use of this software.
+*
+* Permission is granted to anyone to use this software for any purpose,
+* including commercial applications, and to alter it and redistribute it
+* freely, subject to the following restrictions:
+*
+* 1. The origin of this software must not be misrepresented; you must not
+*    claim that you wrote the original software. If you use this software
+*    in a product, an acknowledgment in the product documentation would
+*    be appreciated but is not required.
+*
+* 2. Altered source versions must be plainly marked as such, and must not
+*    be misrepresented as being the original software.
+*
+* 3. This notice may not be removed or altered from any source
+*    distribution.
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "fc8.h"
+#include "fc8-archive.h"
+
+typedef struct {
+    uint32_t hash;
+    const char *name;
+    uint32_t index;
+} archive_sort_t;
+
+/* FNV-1a hash of the entry name */
+uint32_t ArchiveHashName(const char *name)
+{
+    uint32_t hash = 2166136261UL;
+
+    while (*name)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+static int CompareEntries(uint32_t hash1, const char *name1, uint32_t hash2, const char *name2)
+{
+    if (hash1 != hash2)
+        return hash1 < hash2 ? -1 : 1;
+
+    return strcmp(name1, name2);
+}
+
+static int CompareSortEntries(const void *a, const void *b)
+{
+    const archive_sort_t *e1 = (const archive_sort_t *)a;
+    const archive_sort_t *e2 = (const archive_sort_t *)b;
+
+    return CompareEntries(e1->hash, e1->name, e2->hash, e2->name);
+}
+
+uint32_t ArchiveEncode(const char **names, const uint8_t **data, const uint32_t *sizes, uint32_t numEntries,
+    const uint8_t *shared, uint32_t sharedSize, uint8_t *out, uint32_t outsize)
+{
+    archive_sort_t *sorted = (archive_sort_t*) 0;
+    uint8_t *history = (uint8_t*) 0, *entry;
+    uint32_t i, pos, nameLength, maxSize = 0, compressedSize;
+
+    /* Check arguments */
+    if ((!out) || (sharedSize && !shared))
+        goto fail;
+
+    /* Earlier bytes of the shared block are out of reach of every entry */
+    if (sharedSize > FC8_ARCHIVE_MAX_SHARED_SIZE)
+    {
+        shared += sharedSize - FC8_ARCHIVE_MAX_SHARED_SIZE;
+        sharedSize = FC8_ARCHIVE_MAX_SHARED_SIZE;
+    }
+
+    pos = FC8_ARCHIVE_HEADER_SIZE + numEntries * FC8_ARCHIVE_ENTRY_SIZE;
+    if (outsize < pos + sharedSize)
+        goto fail;
+
+    /* Sort the directory by name hash, so entries can be found with a binary search */
+    sorted = (archive_sort_t*)malloc((numEntries ? numEntries : 1) * sizeof(archive_sort_t));
+    if (!sorted)
+        goto fail;
+
+    for (i=0; i<numEntries; i++)
+    {
+        sorted[i].hash = ArchiveHashName(names[i]);
+        sorted[i].name = names[i];
+        sorted[i].index = i;
+
+        if (sizes[i] > maxSize)
+            maxSize = sizes[i];
+    }
+    qsort(sorted, numEntries, sizeof(archive_sort_t), CompareSortEntries);
+
+    /* Set header data */
+    out[0] = 'F';
+    out[1] = 'C';
+    out[2] = '8';
+    out[3] = 'a';
+
+    SetUInt32(out + FC8_ARCHIVE_NUM_ENTRIES_OFFSET, numEntries);
+
+    /* Names, stored with their terminating zero so they can be compared in place */
+    for (i=0; i<numEntries; i++)
+    {
+        entry = out + FC8_ARCHIVE_HEADER_SIZE + i * FC8_ARCHIVE_ENTRY_SIZE;
+
+        // duplicate names can't be looked up
+        if (i > 0 && CompareSortEntries(&sorted[i-1], &sorted[i]) == 0)
+            goto fail;
+
+        nameLength = (uint32_t)strlen(sorted[i].name) + 1;
+        if (outsize - pos < nameLength)
+            goto fail;
+
+        memcpy(out + pos, sorted[i].name, nameLength);
+        SetUInt32(entry + FC8_ARCHIVE_ENTRY_HASH_OFFSET, sorted[i].hash);
+        SetUInt32(entry + FC8_ARCHIVE_ENTRY_NAME_OFFSET, pos);
+        pos += nameLength;
+    }
+
+    /* The shared block is stored uncompressed, since the decoder copies it in front of each entry */
+    SetUInt32(out + FC8_ARCHIVE_SHARED_OFFSET, sharedSize ? pos : 0);
+    SetUInt32(out + FC8_ARCHIVE_SHARED_SIZE_OFFSET, sharedSize);
+    if (sharedSize)
+    {
+        if (outsize - pos < sharedSize)
+            goto fail;
+
+        memcpy(out + pos, shared, sharedSize);
+        pos += sharedSize;
+
+        // each entry is compressed with the shared block immediately before it
+        history = (uint8_t*)malloc(sharedSize + maxSize);
+        if (!history)
+            goto fail;
+        memcpy(history, shared, sharedSize);
+    }
+
+    /* Compressed entries */
+    for (i=0; i<numEntries; i++)
+    {
+        uint32_t index = sorted[i].index;
+
+        entry = out + FC8_ARCHIVE_HEADER_SIZE + i * FC8_ARCHIVE_ENTRY_SIZE;
+
+        if (history)
+        {
+            memcpy(history + sharedSize, data[index], sizes[index]);
+            compressedSize = EncodeTokens(history, sharedSize, sizes[index], out + pos, outsize - pos);
+        }
+        else
+            compressedSize = EncodeTokens(data[index], 0, sizes[index], out + pos, outsize - pos);
+
+        // error?
+        if (!compressedSize)
+            goto fail;
+
+        SetUInt32(entry + FC8_ARCHIVE_ENTRY_DATA_OFFSET, pos);
+        SetUInt32(entry + FC8_ARCHIVE_ENTRY_COMPRESSED_SIZE_OFFSET, compressedSize);
+        SetUInt32(entry + FC8_ARCHIVE_ENTRY_DECODED_SIZE_OFFSET, sizes[index]);
+        pos += compressedSize;
+    }
+
+    free(history);
+    free(sorted);
+
+    /* Return size of the archive */
+    return pos;
+
+
+fail:
+    /* Exit routine for failure situations */
+    free(history);
+    free(sorted);
+    return 0;
+}
+
+static int IsArchive(const uint8_t *archive, uint32_t archivesize)
+{
+    uint32_t numEntries;
+
+    /* Does the input buffer at least contain the header? */
+    if (archivesize < FC8_ARCHIVE_HEADER_SIZE)
+        return 0;
+
+    /* Check magic number */
+    if ((archive[0] != 'F') || (archive[1] != 'C') || (archive[2] != '8') || (archive[3] != 'a'))
+        return 0;
+
+    /* Does the directory fit? */
+    numEntries = GetUInt32(&archive[FC8_ARCHIVE_NUM_ENTRIES_OFFSET]);
+    if (numEntries > (archivesize - FC8_ARCHIVE_HEADER_SIZE) / FC8_ARCHIVE_ENTRY_SIZE)
+        return 0;
+
+    return 1;
+}
+
+static const uint8_t* GetEntry(const uint8_t *archive, uint32_t index)
+{
+    return archive + FC8_ARCHIVE_HEADER_SIZE + index * FC8_ARCHIVE_ENTRY_SIZE;
+}
+
+/* Returns the entry's name, or NULL if it isn't a zero terminated string within the archive */
+static const char* GetEntryName(const uint8_t *archive, uint32_t archivesize, const uint8_t *entry)
+{
+    uint32_t nameOffset = GetUInt32(&entry[FC8_ARCHIVE_ENTRY_NAME_OFFSET]);
+
+    if (nameOffset >= archivesize || !memchr(archive + nameOffset, 0, archivesize - nameOffset))
+        return (const char*) 0;
+
+    return (const char *)archive + nameOffset;
+}
+
+uint32_t ArchiveFind(const uint8_t *archive, uint32_t archivesize, const char *name)
+{
+    uint32_t hash, low, high, mid;
+    const uint8_t *entry;
+    const char *entryName;
+    int result;
+
+    if (!IsArchive(archive, archivesize))
+        return FC8_ARCHIVE_NOT_FOUND;
+
+    hash = ArchiveHashName(name);
+
+    /* Binary search of the directory, comparing names in place only when the hashes match */
+    low = 0;
+    high = GetUInt32(&archive[FC8_ARCHIVE_NUM_ENTRIES_OFFSET]);
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        entry = GetEntry(archive, mid);
+
+        entryName = GetEntryName(archive, archivesize, entry);
+        if (!entryName)
+            return FC8_ARCHIVE_NOT_FOUND;
+
+        result = CompareEntries(hash, name, GetUInt32(&entry[FC8_ARCHIVE_ENTRY_HASH_OFFSET]), entryName);
+        if (result == 0)
+            return mid;
+        else if (result < 0)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    return FC8_ARCHIVE_NOT_FOUND;
+}
+
+uint32_t ArchiveGetNumEntries(const uint8_t *archive, uint32_t archivesize)
+{
+    if (!IsArchive(archive, archivesize))
+        return 0;
+
+    return GetUInt32(&archive[FC8_ARCHIVE_NUM_ENTRIES_OFFSET]);
+}
+
+const char* ArchiveGetName(const uint8_t *archive, uint32_t archivesize, uint32_t index)
+{
+    if (index >= ArchiveGetNumEntries(archive, archivesize))
+        return (const char*) 0;
+
+    return GetEntryName(archive, archivesize, GetEntry(archive, index));
+}
+
+uint32_t ArchiveGetDecodedSize(const uint8_t *archive, uint32_t archivesize, uint32_t index)
+{
+    if (index >= ArchiveGetNumEntries(archive, archivesize))
+        return 0;
+
+    return GetUInt32(&GetEntry(archive, index)[FC8_ARCHIVE_ENTRY_DECODED_SIZE_OFFSET]);
+}
+
+uint32_t ArchiveGetSharedSize(const uint8_t *archive, uint32_t archivesize)
+{
+    if (!IsArchive(archive, archivesize))
+        return 0;
+
+    return GetUInt32(&archive[FC8_ARCHIVE_SHARED_SIZE_OFFSET]);
+}
+
+uint32_t ArchiveDecode(const uint8_t *archive, uint32_t archivesize, uint32_t index, uint8_t *out, uint32_t outsize)
+{
+    const uint8_t *entry;
+    uint32_t sharedOffset, sharedSize, dataOffset, compressedSize, decodedSize;
+
+    if (index >= ArchiveGetNumEntries(archive, archivesize))
+        return 0;
+
+    entry = GetEntry(archive, index);
+    sharedOffset = GetUInt32(&archive[FC8_ARCHIVE_SHARED_OFFSET]);
+    sharedSize = GetUInt32(&archive[FC8_ARCHIVE_SHARED_SIZE_OFFSET]);
+    dataOffset = GetUInt32(&entry[FC8_ARCHIVE_ENTRY_DATA_OFFSET]);
+    compressedSize = GetUInt32(&entry[FC8_ARCHIVE_ENTRY_COMPRESSED_SIZE_OFFSET]);
+    decodedSize = GetUInt32(&entry[FC8_ARCHIVE_ENTRY_DECODED_SIZE_OFFSET]);
+
+    /* Check that the data lies within the archive, and the output fits */
+    if (sharedOffset > archivesize || sharedSize > archivesize - sharedOffset ||
+        dataOffset > archivesize || compressedSize == 0 || compressedSize > archivesize - dataOffset ||
+        outsize < sharedSize || outsize - sharedSize < decodedSize)
+        return 0;
+
+    /* Backrefs may reach into the shared block, so it must directly precede the output */
+    if (sharedSize)
+        memcpy(out, archive + sharedOffset, sharedSize);
+
+    if (DecodeTokens(archive + dataOffset, out + sharedSize) != decodedSize)
+        return 0;
+
+    return decodedSize;
+}
@@ -0,0 +1,54 @@
+/*
+* FC8 compression by Steve Chamberlin
+* Derived from liblzg by Marcus Geelnard
+*/
+
+#ifndef _FC8_ARCHIVE_H_
+#define _FC8_ARCHIVE_H_
+
+// FC8a archive format: a sorted directory followed by entry names, an optional
+// uncompressed shared block, and the compressed entries packed back-to-back.
+// All values are big-endian uint32 offsets from the start of the archive, so the
+// file can be used directly from a memory mapping.
+#define FC8_ARCHIVE_HEADER_SIZE 16
+#define FC8_ARCHIVE_NUM_ENTRIES_OFFSET 4
+#define FC8_ARCHIVE_SHARED_OFFSET 8
+#define FC8_ARCHIVE_SHARED_SIZE_OFFSET 12
+
+// directory entries, sorted by name hash, then by name
+#define FC8_ARCHIVE_ENTRY_SIZE 20
+#define FC8_ARCHIVE_ENTRY_HASH_OFFSET 0
+#define FC8_ARCHIVE_ENTRY_NAME_OFFSET 4
+#define FC8_ARCHIVE_ENTRY_DATA_OFFSET 8
+#define FC8_ARCHIVE_ENTRY_COMPRESSED_SIZE_OFFSET 12
+#define FC8_ARCHIVE_ENTRY_DECODED_SIZE_OFFSET 16
+
+#define FC8_ARCHIVE_NOT_FOUND 0xFFFFFFFF
+
+// backrefs reach at most 128K-1 bytes back, so only the end of a larger shared block is stored
+#define FC8_ARCHIVE_MAX_SHARED_SIZE (128L*1024 - 1)
+
+uint32_t ArchiveHashName(const char *name);
+
+// Build an archive of numEntries files. If sharedSize is nonzero, every entry is compressed
+// with the shared block as its starting history, of which only the last FC8_ARCHIVE_MAX_SHARED_SIZE
+// bytes are kept. Returns the archive size, or 0 upon failure.
+uint32_t ArchiveEncode(const char **names, const uint8_t **data, const uint32_t *sizes, uint32_t numEntries,
+    const uint8_t *shared, uint32_t sharedSize, uint8_t *out, uint32_t outsize);
+
+// Returns the index of the named entry, or FC8_ARCHIVE_NOT_FOUND.
+uint32_t ArchiveFind(const uint8_t *archive, uint32_t archivesize, const char *name);
+
+// Entry information, checked against the archive size. The number of entries is 0 for an
+// invalid archive, and the name is NULL for an invalid entry.
+uint32_t ArchiveGetNumEntries(const uint8_t *archive, uint32_t archivesize);
+const char* ArchiveGetName(const uint8_t *archive, uint32_t archivesize, uint32_t index);
+uint32_t ArchiveGetDecodedSize(const uint8_t *archive, uint32_t archivesize, uint32_t index);
+uint32_t ArchiveGetSharedSize(const uint8_t *archive, uint32_t archivesize);
+
+// Decode an entry into out. When the archive has a shared block, it is copied to the start
+// of out and the entry's data follows it, so outsize must be at least the shared size plus
+// the decoded size. Returns the decoded size of the entry, or 0 upon failure.
+uint32_t ArchiveDecode(const uint8_t *archive, uint32_t archivesize, uint32_t index, uint8_t *out, uint32_t outsize);
+
+#endif // _FC8_ARCHIVE_H_
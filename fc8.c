@@ -26,32 +26,504 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "fc8.h"
+#include "fc8-archive.h"
 
 #ifdef _WIN32
   #include <io.h>
   #include <fcntl.h>
 #endif
 
+// block sizes tried by -b:auto, as powers of two
+#define AUTO_MIN_BLOCK_SHIFT 10
+#define AUTO_MAX_BLOCK_SHIFT 18
+#define AUTO_NUM_CANDIDATES (AUTO_MAX_BLOCK_SHIFT - AUTO_MIN_BLOCK_SHIFT + 1)
+
+// number of evenly spaced sample regions taken from the input, each the size of the largest candidate block
+#define AUTO_NUM_SAMPLES 4
+
+typedef struct {
+    uint32_t blockSize;
+    uint32_t numBlocks;
+    uint32_t sampleSize;
+    uint32_t compressedSize;
+    uint32_t estimatedSize;
+    double decodeMicros;
+    uint8_t *buf;
+    uint32_t *blockOffsets;
+} auto_trial_t;
+
 void ShowUsage(char *prgName)
 {
     fprintf(stderr, "Usage: %s [options] infile [outfile]\n", prgName);
+    fprintf(stderr, "       %s -a [-D:file] archive infile...\n", prgName);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, " -b:NNN  compress the input as multiple independent blocks of size NNN bytes\n");
+    fprintf(stderr, " -b:auto  choose the block size by compressing samples of the input at several sizes,\n");
+    fprintf(stderr, "          which on its own picks the largest size; use it with -l or -s\n");
+    fprintf(stderr, " -l:NNN  with -b:auto, limit the average decode time per block to NNN microseconds\n");
+    fprintf(stderr, " -s:NNN  with -b:auto, use the smallest block size within NNN percent of the best result\n");
+    fprintf(stderr, " -lz4  convert a raw LZ4 compressed block to FC8, without recompressing\n");
+    fprintf(stderr, " -t  choose the BR2 lengths for the input, if storing them in the header makes it smaller\n");
+    fprintf(stderr, " -i  compress for in-place decompression, or decompress in place with -d\n");
     fprintf(stderr, " -d  decompress\n");
+    fprintf(stderr, " -x:NAME  decompress the entry NAME from an archive\n");
+    fprintf(stderr, " -a  create an archive of all the input files\n");
+    fprintf(stderr, " -D:file  with -a, compress every archive entry using the file as shared history\n");
     fprintf(stderr, "\nIf no output file is given, stdout is used for output.\n");
 }
 
+// Read a whole file into a newly allocated buffer. Returns the buffer, or NULL upon failure.
+// An empty file is a failure unless allowEmpty is set.
+uint8_t* ReadFile(const char *inName, uint32_t *inSize, int allowEmpty)
+{
+    FILE *inFile;
+    size_t fileSize;
+    uint8_t *inBuf = (unsigned char*) 0;
+
+    inFile = fopen(inName, "rb");
+    if (inFile)
+    {
+        fseek(inFile, 0, SEEK_END);
+        fileSize = (size_t) ftell(inFile);
+        fseek(inFile, 0, SEEK_SET);
+        if (fileSize > 0 || allowEmpty)
+        {
+            *inSize = (uint32_t) fileSize;
+            inBuf = (unsigned char*) malloc(*inSize ? *inSize : 1);
+            if (inBuf)
+            {
+                if (fread(inBuf, 1, *inSize, inFile) != *inSize)
+                {
+                    fprintf(stderr, "Error reading \"%s\".\n", inName);
+                    free(inBuf);
+                    inBuf = (unsigned char*) 0;
+                }				
+            }
+            else
+                fprintf(stderr, "Out of memory.\n");
+        }
+        else
+            fprintf(stderr, "Input file \"%s\" is empty.\n", inName);
+
+        fclose(inFile);
+    }
+    else
+        fprintf(stderr, "Unable to open file \"%s\".\n", inName);
+
+    return inBuf;
+}
+
+// Write a buffer to the named file, or to stdout if outName is NULL
+void WriteFile(const char *outName, const uint8_t *outBuf, uint32_t outSize)
+{
+    FILE *outFile;
+
+    if (outName)
+    {
+        outFile = fopen(outName, "wb");
+        if (!outFile)
+            fprintf(stderr, "Unable to open file \"%s\".\n", outName);
+    }
+    else
+    {
+        #ifdef _WIN32
+		_setmode(_fileno(stdout),O_BINARY);
+	  #endif
+        outFile = stdout;
+    }
+
+    if (outFile)
+    {
+        // Write data
+        if (fwrite(outBuf, 1, outSize, outFile) != outSize)
+            fprintf(stderr, "Error writing to output file.\n");
+
+        // Close file
+        if (outName)
+            fclose(outFile);
+    }
+}
+
+// Create an archive from the arguments following -a: [-D:file] archive infile...
+int CreateArchive(int argc, char **argv, char *prgName)
+{
+    const char **names;
+    const uint8_t **data;
+    uint32_t *sizes;
+    uint8_t *sharedBuf = (uint8_t*) 0, *outBuf = (uint8_t*) 0;
+    uint32_t i, numEntries = 0, sharedSize = 0, inTotal = 0, maxOutSize, outSize = 0;
+    int arg = 0;
+
+    if (arg < argc && strncmp("-D:", argv[arg], 3) == 0)
+    {
+        sharedBuf = ReadFile(&argv[arg][3], &sharedSize, 0);
+        if (!sharedBuf)
+            return 0;
+        // ArchiveEncode keeps only the end of a larger shared block
+        if (sharedSize > FC8_ARCHIVE_MAX_SHARED_SIZE)
+            fprintf(stderr, "Using the last %d bytes of the shared file.\n", (int)FC8_ARCHIVE_MAX_SHARED_SIZE);
+        arg++;
+    }
+
+    if (argc - arg < 2)
+    {
+        ShowUsage(prgName);
+        free(sharedBuf);
+        return 0;
+    }
+
+    names = (const char**) calloc(argc, sizeof(char*));
+    data = (const uint8_t**) calloc(argc, sizeof(uint8_t*));
+    sizes = (uint32_t*) calloc(argc, sizeof(uint32_t));
+    if (!names || !data || !sizes)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        goto done;
+    }
+
+    // Read the input files, which are named in the archive as given on the command line
+    for (i=arg+1; i<(uint32_t)argc; i++)
+    {
+        names[numEntries] = argv[i];
+        data[numEntries] = ReadFile(argv[i], &sizes[numEntries], 1);
+        if (!data[numEntries])
+            goto done;
+        inTotal += sizes[numEntries];
+        numEntries++;
+    }
+
+    // Estimate the maximum size of the archive in worst case
+    maxOutSize = FC8_ARCHIVE_HEADER_SIZE + sharedSize + inTotal * 2;
+    for (i=0; i<numEntries; i++)
+        maxOutSize += FC8_ARCHIVE_ENTRY_SIZE + (uint32_t)strlen(names[i]) + 1;
+
+    outBuf = (uint8_t*) malloc(maxOutSize);
+    if (!outBuf)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        goto done;
+    }
+
+    outSize = ArchiveEncode(names, data, sizes, numEntries, sharedBuf, sharedSize, outBuf, maxOutSize);
+    if (outSize)
+    {
+        fprintf(stderr, "Archived %d files: %d bytes (%d%% of the original)\n", numEntries, outSize, (int)((100.0 * outSize) / (inTotal ? inTotal : 1)));
+        WriteFile(argv[arg], outBuf, outSize);
+    }
+    else
+        fprintf(stderr, "Operation failed!\n");
+
+done:
+    for (i=0; i<numEntries; i++)
+        free((void*)data[i]);
+    free(names);
+    free((void*)data);
+    free(sizes);
+    free(sharedBuf);
+    free(outBuf);
+
+    return 0;
+}
+
+// Decompress one entry from an archive, or list the entries if name is NULL
+void ExtractFromArchive(const uint8_t *inBuf, uint32_t inSize, const char *name, const char *outName)
+{
+    uint32_t index, numEntries, sharedSize, decodedSize;
+    const char *entryName;
+    uint8_t *outBuf;
+
+    if (!name)
+    {
+        numEntries = ArchiveGetNumEntries(inBuf, inSize);
+        if (numEntries == 0 && GetUInt32(&inBuf[FC8_ARCHIVE_NUM_ENTRIES_OFFSET]) != 0)
+        {
+            fprintf(stderr, "Archive directory is damaged.\n");
+            return;
+        }
+
+        fprintf(stderr, "Archive entries:\n");
+        for (index=0; index<numEntries; index++)
+        {
+            entryName = ArchiveGetName(inBuf, inSize, index);
+            fprintf(stderr, "%10d  %s\n", ArchiveGetDecodedSize(inBuf, inSize, index), entryName ? entryName : "(damaged name)");
+        }
+        return;
+    }
+
+    index = ArchiveFind(inBuf, inSize, name);
+    if (index == FC8_ARCHIVE_NOT_FOUND)
+    {
+        fprintf(stderr, "\"%s\" not found in archive.\n", name);
+        return;
+    }
+
+    // the shared block, if any, is placed in front of the decoded entry
+    sharedSize = ArchiveGetSharedSize(inBuf, inSize);
+    decodedSize = ArchiveGetDecodedSize(inBuf, inSize, index);
+    outBuf = (uint8_t*) malloc(sharedSize + decodedSize ? sharedSize + decodedSize : 1);
+    if (!outBuf)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return;
+    }
+
+    if (ArchiveDecode(inBuf, inSize, index, outBuf, sharedSize + decodedSize) == decodedSize)
+    {
+        fprintf(stderr, "Decompressed file is %d bytes\n", decodedSize);
+        WriteFile(outName, outBuf + sharedSize, decodedSize);
+    }
+    else
+        fprintf(stderr, "Operation failed!\n");
+
+    free(outBuf);
+}
+
+// Convert an LZ4 block to FC8 format
+void TranscodeFile(const uint8_t *inBuf, uint32_t inSize, const char *outName)
+{
+    uint32_t maxOutSize, outSize, decodedSize;
+    uint8_t *outBuf;
+
+    // Estimate the maximum size of the converted data in worst case. Long LZ4 matches take
+    // one extra length byte per 255 bytes, but FC8 needs a 3 byte backref per 256 bytes.
+    maxOutSize = FC8_HEADER_SIZE + inSize * 4 + 1;
+
+    outBuf = (uint8_t*) malloc(maxOutSize);
+    if (!outBuf)
+    {
+        fprintf(stderr, "Out of memory!\n");
+        return;
+    }
+
+    outSize = TranscodeLZ4(inBuf, inSize, outBuf, maxOutSize);
+    if (outSize)
+    {
+        decodedSize = GetUInt32(&outBuf[FC8_DECODED_SIZE_OFFSET]);
+        fprintf(stderr, "Result: %d bytes (%d%% of the original)\n", outSize,
+            (int)((100.0 * outSize) / (decodedSize ? decodedSize : 1)));
+        WriteFile(outName, outBuf, outSize);
+    }
+    else
+        fprintf(stderr, "Input is not a valid LZ4 block.\n");
+
+    free(outBuf);
+}
+
+// Decode compressed data placed at the end of a buffer of the decoded size plus the margin,
+// as a memory-constrained loader would. Returns the buffer, or NULL upon failure.
+uint8_t* DecodeInPlaceCopy(const uint8_t *inBuf, uint32_t inSize, uint32_t *outSize)
+{
+    uint32_t margin, bufSize;
+    uint8_t *buf;
+
+    margin = GetInPlaceMargin(inBuf, inSize);
+    if (margin == 0xFFFFFFFF)
+        return (uint8_t*) 0;
+
+    *outSize = GetUInt32(&inBuf[FC8_DECODED_SIZE_OFFSET]);
+    bufSize = *outSize + margin;
+    if (bufSize < inSize)
+        bufSize = inSize;
+
+    buf = (uint8_t*) malloc(bufSize);
+    if (!buf)
+        return (uint8_t*) 0;
+
+    memcpy(buf + bufSize - inSize, inBuf, inSize);
+    if (DecodeInPlace(buf, bufSize, inSize) != *outSize)
+    {
+        free(buf);
+        return (uint8_t*) 0;
+    }
+
+    fprintf(stderr, "In-place decompression needs %d bytes (%d byte margin)\n", bufSize, bufSize - *outSize);
+    return buf;
+}
+
+// Measure the average time to decode one block of a trial, in microseconds
+static double TimeTrialDecode(auto_trial_t *t, uint8_t *scratch)
+{
+    clock_t start, elapsed;
+    uint32_t i, passes = 0;
+
+    start = clock();
+    do
+    {
+        for (i=0; i<t->numBlocks; i++)
+            Decode(t->buf + t->blockOffsets[i], FC8_HEADER_SIZE, scratch, t->blockSize);
+        passes++;
+        elapsed = clock() - start;
+    } while (elapsed < CLOCKS_PER_SEC / 20);
+
+    return (1000000.0 * elapsed / CLOCKS_PER_SEC) / ((double)passes * t->numBlocks);
+}
+
+// Choose a block size for the FC8b format by compressing sample regions of the input
+// at each candidate size. Returns the chosen block size, which is insize for a single block,
+// or 0 upon failure.
+uint32_t AutoBlockSize(const uint8_t *in, uint32_t insize, double maxDecodeMicros, uint32_t slackPercent)
+{
+    auto_trial_t trials[AUTO_NUM_CANDIDATES];
+    uint32_t regionSize, numRegions, regionStride, bestSize = 0xFFFFFFFF, chosen = 0;
+    uint8_t *scratch = (uint8_t*) 0;
+    int c, failed = 0, limitMissed = 0;
+
+    // too small to split, so no candidate could be tried
+    if (insize < (1L << AUTO_MIN_BLOCK_SHIFT))
+    {
+        fprintf(stderr, "Input is smaller than the smallest block size, using a single block\n");
+        return insize;
+    }
+
+    // sample regions are the size of the largest candidate block, or the whole input if smaller
+    regionSize = 1L << AUTO_MAX_BLOCK_SHIFT;
+    if (regionSize > insize)
+        regionSize = insize;
+    numRegions = insize / regionSize;
+    if (numRegions > AUTO_NUM_SAMPLES)
+        numRegions = AUTO_NUM_SAMPLES;
+    regionStride = numRegions > 1 ? (insize - regionSize) / (numRegions - 1) : 0;
+
+    memset(trials, 0, sizeof(trials));
+
+    // compress the samples at every candidate size, the trials are independent
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) reduction(|:failed)
+    #endif
+    for (c=0; c<AUTO_NUM_CANDIDATES; c++)
+    {
+        auto_trial_t *t = &trials[c];
+        uint32_t r, pos, maxSize, blockIndex = 0;
+
+        t->blockSize = 1L << (AUTO_MIN_BLOCK_SHIFT + c);
+        if (t->blockSize >= 2 * regionSize)
+            continue;
+
+        t->numBlocks = ((regionSize + t->blockSize - 1) / t->blockSize) * numRegions;
+        maxSize = regionSize * 2 * numRegions + t->numBlocks * FC8_HEADER_SIZE;
+        t->buf = (uint8_t*) malloc(maxSize);
+        t->blockOffsets = (uint32_t*) malloc(t->numBlocks * sizeof(uint32_t));
+        if (!t->buf || !t->blockOffsets)
+        {
+            failed = 1;
+            continue;
+        }
+
+        for (r=0; r<numRegions && !failed; r++)
+        {
+            const uint8_t *region = in + regionStride * r;
+
+            for (pos=0; pos<regionSize; pos+=t->blockSize)
+            {
+                uint32_t thisBlockSize = regionSize - pos < t->blockSize ? regionSize - pos : t->blockSize;
+                uint32_t processedBlockSize = Encode(region + pos, thisBlockSize, t->buf + t->compressedSize, maxSize - t->compressedSize);
+
+                // error?
+                if (!processedBlockSize)
+                {
+                    failed = 1;
+                    break;
+                }
+
+                t->blockOffsets[blockIndex++] = t->compressedSize;
+                t->compressedSize += processedBlockSize;
+            }
+        }
+
+        t->sampleSize = regionSize * numRegions;
+    }
+
+    scratch = (uint8_t*) malloc(1L << AUTO_MAX_BLOCK_SHIFT);
+    if (failed || !scratch)
+    {
+        fprintf(stderr, "Block size search failed.\n");
+        goto done;
+    }
+
+    // extrapolate the sample results to the whole input, and time decoding serially so the timings don't interfere
+    for (c=0; c<AUTO_NUM_CANDIDATES; c++)
+    {
+        auto_trial_t *t = &trials[c];
+        uint32_t totalBlocks;
+
+        if (!t->sampleSize)
+            continue;
+
+        totalBlocks = (insize + t->blockSize - 1) / t->blockSize;
+        t->estimatedSize = (uint32_t)((double)t->compressedSize * insize / t->sampleSize);
+        if (totalBlocks > 1)
+            t->estimatedSize += FC8_BLOCK_HEADER_SIZE + totalBlocks * sizeof(uint32_t);
+        t->decodeMicros = TimeTrialDecode(t, scratch);
+
+        if ((maxDecodeMicros <= 0 || t->decodeMicros <= maxDecodeMicros) && t->estimatedSize < bestSize)
+            bestSize = t->estimatedSize;
+    }
+
+    // pick the smallest block size that meets the decode time limit and is within the slack of the best size
+    for (c=0; c<AUTO_NUM_CANDIDATES && !chosen; c++)
+    {
+        auto_trial_t *t = &trials[c];
+
+        if (t->sampleSize && (maxDecodeMicros <= 0 || t->decodeMicros <= maxDecodeMicros) &&
+            (uint64_t)t->estimatedSize * 100 <= (uint64_t)bestSize * (100 + slackPercent))
+            chosen = t->blockSize;
+    }
+
+    // if none meets the decode time limit, fall back to the smallest block size, which decodes fastest
+    for (c=0; c<AUTO_NUM_CANDIDATES && !chosen; c++)
+    {
+        if (trials[c].sampleSize)
+        {
+            chosen = trials[c].blockSize;
+            limitMissed = 1;
+        }
+    }
+
+    // report the trade-offs
+    fprintf(stderr, "Block size  Est. size  Ratio  Decode us/block\n");
+    for (c=0; c<AUTO_NUM_CANDIDATES; c++)
+    {
+        auto_trial_t *t = &trials[c];
+
+        if (!t->sampleSize)
+            continue;
+
+        fprintf(stderr, "%10d %10d %5d%% %16.1f%s\n", t->blockSize, t->estimatedSize, (int)((100.0 * t->estimatedSize) / insize),
+            t->decodeMicros, t->blockSize == chosen ? "  <-" : "");
+    }
+
+    if (limitMissed)
+        fprintf(stderr, "Warning: no block size meets the decode time limit, using %d byte blocks\n", chosen);
+    else if (chosen)
+        fprintf(stderr, "Using %d byte blocks\n", chosen);
+
+done:
+    for (c=0; c<AUTO_NUM_CANDIDATES; c++)
+    {
+        free(trials[c].buf);
+        free(trials[c].blockOffsets);
+    }
+    free(scratch);
+
+    return chosen;
+}
+
 int main(int argc, char **argv)
 {
-    char *inName, *outName;
-    FILE *inFile, *outFile;
+    char *inName, *outName, *extractName = NULL;
     uint32_t inSize = 0, outSize = 0;
     uint32_t maxOutSize;
     uint8_t *inBuf, *outBuf;
-    size_t fileSize;
     uint8_t decompress = 0;
+    uint8_t fromLZ4 = 0;
+    uint8_t inPlace = 0;
+    uint8_t adaptive = 0;
     uint32_t blockSize = 0;
+    uint8_t autoBlock = 0;
+    double maxDecodeMicros = 0;
+    uint32_t slackPercent = 0;
     uint32_t i, numBlocks = 0;
     int arg;
 
@@ -64,12 +536,32 @@ int main(int argc, char **argv)
     {
         if (strcmp("-d", argv[arg]) == 0)
             decompress = 1;
+        else if (strcmp("-t", argv[arg]) == 0)
+            adaptive = 1;
+        else if (strcmp("-i", argv[arg]) == 0)
+            inPlace = 1;
+        else if (strcmp("-lz4", argv[arg]) == 0)
+            fromLZ4 = 1;
+        else if (strcmp("-a", argv[arg]) == 0)
+            return CreateArchive(argc - arg - 1, argv + arg + 1, argv[0]);
+        else if (strncmp("-x:", argv[arg], 3) == 0)
+        {
+            decompress = 1;
+            extractName = &argv[arg][3];
+        }
         else if (strncmp("-b", argv[arg], 2) == 0)
         {
             if (argv[arg][2] != ':')
                 ShowUsage(argv[0]);
-            blockSize = atoi(&argv[arg][3]);
+            if (strcmp("auto", &argv[arg][3]) == 0)
+                autoBlock = 1;
+            else
+                blockSize = atoi(&argv[arg][3]);
         }
+        else if (strncmp("-l:", argv[arg], 3) == 0)
+            maxDecodeMicros = atof(&argv[arg][3]);
+        else if (strncmp("-s:", argv[arg], 3) == 0)
+            slackPercent = atoi(&argv[arg][3]);
         else if (!inName)
             inName = argv[arg];
         else if (!outName)
@@ -86,50 +578,58 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    if (decompress && blockSize != 0)
+    if (decompress && (blockSize != 0 || autoBlock))
     {
         fprintf(stderr, "Block size will be read from the input data, -b option ignored\n");
     }
 
     // Read input file
-    inBuf = (unsigned char*) 0;
-    inFile = fopen(inName, "rb");
-    if (inFile)
+    inBuf = ReadFile(inName, &inSize, 0);
+    if (!inBuf)
+        return 0;
+
+    if (decompress && inSize >= FC8_ARCHIVE_HEADER_SIZE && inBuf[0] == 'F' && inBuf[1] == 'C' && inBuf[2] == '8' && inBuf[3] == 'a')
     {
-        fseek(inFile, 0, SEEK_END);
-        fileSize = (size_t) ftell(inFile);
-        fseek(inFile, 0, SEEK_SET);
-        if (fileSize > 0)
+        ExtractFromArchive(inBuf, inSize, extractName, outName);
+        free(inBuf);
+        return 0;
+    }
+
+    if (fromLZ4 && !decompress)
+    {
+        if (blockSize != 0 || autoBlock)
+            fprintf(stderr, "LZ4 input is converted as a single block, -b option ignored\n");
+        TranscodeFile(inBuf, inSize, outName);
+        free(inBuf);
+        return 0;
+    }
+
+    if (decompress && inPlace)
+    {
+        outBuf = DecodeInPlaceCopy(inBuf, inSize, &outSize);
+        if (outBuf)
         {
-            inSize = (uint32_t) fileSize;
-            inBuf = (unsigned char*) malloc(inSize);
-            if (inBuf)
-            {
-                if (fread(inBuf, 1, inSize, inFile) != inSize)
-                {
-                    fprintf(stderr, "Error reading \"%s\".\n", inName);
-                    free(inBuf);
-                    outBuf = (unsigned char*) 0;
-                }				
-            }
-            else
-                fprintf(stderr, "Out of memory.\n");
+            fprintf(stderr, "Decompressed file is %d bytes\n", outSize);
+            WriteFile(outName, outBuf, outSize);
+            free(outBuf);
         }
         else
-            fprintf(stderr, "Input file is empty.\n");
-
-        fclose(inFile);
+            fprintf(stderr, "Operation failed!\n");
+        free(inBuf);
+        return 0;
     }
-    else
-        fprintf(stderr, "Unable to open file \"%s\".\n", inName);
 
-    if (!inBuf)
+    if (extractName)
+    {
+        fprintf(stderr, "Input is not an FC8 archive.\n");
+        free(inBuf);
         return 0;
+    }
 
     if (decompress)
     {
         // determine blockSize and numBlocks
-        if (inBuf[0] != 'F' || inBuf[1] != 'C' || inBuf[2] != '8' || (inBuf[3] != '_' && inBuf[3] != 'b'))
+        if (inBuf[0] != 'F' || inBuf[1] != 'C' || inBuf[2] != '8' || (inBuf[3] != '_' && inBuf[3] != 'b' && inBuf[3] != 'i' && inBuf[3] != 't'))
         {
             fprintf(stderr, "Input is not an FC8 compressed file.\n");
             return 0;
@@ -151,12 +651,40 @@ int main(int argc, char **argv)
     }
     else
     {
-        // Estimate the maximum size of compressed data in worst case
-        maxOutSize = inSize * 2; 
+        // Estimate the maximum size of compressed data in worst case, with room for the
+        // largest header (FC8t) and the EOF token
+        maxOutSize = FC8_TABLE_HEADER_SIZE + inSize * 2 + 1;
+
+        if (autoBlock)
+        {
+            blockSize = AutoBlockSize(inBuf, inSize, maxDecodeMicros, slackPercent);
+            if (blockSize == 0)
+            {
+                free(inBuf);
+                return 0;
+            }
+            if (blockSize >= inSize)
+                blockSize = 0;
+        }
+
+        if (inPlace && adaptive)
+        {
+            fprintf(stderr, "In-place format uses the default lengths, -t option ignored\n");
+            adaptive = 0;
+        }
+
+        if (inPlace && blockSize != 0)
+        {
+            fprintf(stderr, "In-place format is a single block, -b option ignored\n");
+            blockSize = 0;
+        }
 
         if (blockSize != 0)
         {
             numBlocks = (inSize + blockSize - 1) / blockSize;
+
+            // every block adds its offset, its own header and an EOF token
+            maxOutSize += FC8_BLOCK_HEADER_SIZE + numBlocks * (sizeof(uint32_t) + FC8_HEADER_SIZE + 1);
         }
         else
         {
@@ -194,6 +722,11 @@ int main(int argc, char **argv)
         // process all the blocks
         for (i=0; i<numBlocks; i++)
         {
+            // the last block may be partial
+            uint32_t thisBlockSize = blockSize;
+            if (i == numBlocks-1 && blockSize != 0 && (decompress ? maxOutSize : inSize) % blockSize != 0)
+                thisBlockSize = (decompress ? maxOutSize : inSize) % blockSize;
+
             if (decompress)
             {
                 uint32_t blockOffset = 0, processedBlockSize;
@@ -202,10 +735,10 @@ int main(int argc, char **argv)
                 if (blockSize != maxOutSize)
                     blockOffset = GetUInt32(&inBuf[FC8_BLOCK_HEADER_SIZE + sizeof(uint32_t) * i]);
 
-                processedBlockSize = Decode(inBuf + blockOffset, FC8_HEADER_SIZE, outBuf + blockSize * i, maxOutSize - blockSize * i);
+                processedBlockSize = Decode(inBuf + blockOffset, inSize - blockOffset, outBuf + blockSize * i, maxOutSize - blockSize * i);
 
                 // error?
-                if (processedBlockSize != blockSize)
+                if (processedBlockSize != thisBlockSize)
                 {
                     outSize = 0;
                     break;
@@ -215,7 +748,14 @@ int main(int argc, char **argv)
             }
             else
             {
-                uint32_t processedBlockSize = Encode(inBuf + blockSize * i, blockSize, outBuf + outSize, maxOutSize - outSize);
+                uint32_t processedBlockSize;
+
+                if (inPlace)
+                    processedBlockSize = EncodeInPlace(inBuf, inSize, outBuf, maxOutSize);
+                else if (adaptive)
+                    processedBlockSize = EncodeAdaptive(inBuf + blockSize * i, thisBlockSize, outBuf + outSize, maxOutSize - outSize);
+                else
+                    processedBlockSize = Encode(inBuf + blockSize * i, thisBlockSize, outBuf + outSize, maxOutSize - outSize);
                 
                 // error?
                 if (!processedBlockSize)
@@ -235,6 +775,17 @@ int main(int argc, char **argv)
             }
         }
 
+        // check that the in-place layout decodes correctly
+        if (outSize && !decompress && inPlace)
+        {
+            uint32_t checkSize;
+            uint8_t *checkBuf = DecodeInPlaceCopy(outBuf, outSize, &checkSize);
+
+            if (!checkBuf || checkSize != inSize || memcmp(checkBuf, inBuf, inSize) != 0)
+                outSize = 0;
+            free(checkBuf);
+        }
+
         // save result
         if (outSize)
         {
@@ -244,30 +795,7 @@ int main(int argc, char **argv)
                 fprintf(stderr, "Result: %d bytes (%d%% of the original)\n", outSize, (100 * outSize) / inSize);
 
             // Processed data is now in outBuf, write it...
-            if (outName)
-            {
-                outFile = fopen(outName, "wb");
-                if (!outFile)
-                    fprintf(stderr, "Unable to open file \"%s\".\n", outName);
-            }
-            else
-            {
-                #ifdef _WIN32
-			_setmode(_fileno(stdout),O_BINARY);
-		  #endif
-                outFile = stdout;
-            }
-
-            if (outFile)
-            {
-                // Write data
-                if (fwrite(outBuf, 1, outSize, outFile) != outSize)
-                    fprintf(stderr, "Error writing to output file.\n");
-
-                // Close file
-                if (outName)
-                    fclose(outFile);
-            }
+            WriteFile(outName, outBuf, outSize);
         }
         else
             fprintf(stderr, "Operation failed!\n");
@@ -13,10 +13,38 @@
 #define FC8_BLOCK_HEADER_SIZE 12
 #define FC8_BLOCK_SIZE_OFFSET 8
 
+// for FC8i in-place header, same as FC8_ plus the margin needed for in-place decoding
+#define FC8_INPLACE_HEADER_SIZE 12
+#define FC8_MARGIN_OFFSET 8
+
+// for FC8t header, same as FC8_ plus a table of the 32 BR2 lengths, each stored as length-1
+#define FC8_TABLE_HEADER_SIZE 40
+#define FC8_LENGTH_TABLE_OFFSET 8
+
 uint32_t Encode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize);
 
 uint32_t Decode(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize);
 
+// Compress twice, the second time with BR2 lengths chosen from the first pass's match lengths.
+// Writes an FC8t header with the length table if that is smaller, otherwise an FC8_ header.
+uint32_t EncodeAdaptive(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize);
+
+// In-place decoding. The compressed data of size insize is placed at the end of buf, and is
+// decoded to the start of buf. bufsize must be at least the decoded size plus the margin
+// returned by GetInPlaceMargin, which EncodeInPlace stores in the FC8i header.
+uint32_t EncodeInPlace(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize);
+uint32_t GetInPlaceMargin(const uint8_t *in, uint32_t insize);
+uint32_t DecodeInPlace(uint8_t *buf, uint32_t bufsize, uint32_t insize);
+
+// Headerless token streams. EncodeTokens compresses in[histsize..histsize+insize), using
+// in[0..histsize) as already-seen history. DecodeTokens expects that same history to be
+// present in memory immediately before out.
+uint32_t EncodeTokens(const uint8_t *in, uint32_t histsize, uint32_t insize, uint8_t *out, uint32_t outsize);
+uint32_t DecodeTokens(const uint8_t *in, uint8_t *out);
+
+// Convert a raw LZ4 block (no frame header) to an FC8 compressed buffer, reusing the LZ4 matches
+uint32_t TranscodeLZ4(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize);
+
 uint32_t GetUInt32(const uint8_t *in);
 void SetUInt32(uint8_t *in, uint32_t val);
 